@@ -1,8 +1,11 @@
 #include <irrlicht.h>
 #include <iostream>
 #include <math.h>
+#include <string.h>
 
 #include "irrlichtDebug.hpp"
+#include "runtimeStats.hpp"
+#include "videoCapture.hpp"
 
 using namespace irr;
 
@@ -13,6 +16,13 @@ namespace ig = irr::gui;
 
 // Prototypes
 void drawAxes(irr::video::IVideoDriver * driver);
+// Append a copy of the first buffer of mesh, moved to world space, to the static world mesh
+// Returns the index of the new buffer, which is also its material index in the world node
+u32 addStaticWorldBuffer(is::ISceneManager * smgr, is::SMesh * worldMesh,
+                         is::IMesh * mesh, iv::ITexture * texture,
+                         const ic::matrix4 & transform);
+// Count the scene nodes and their animators below node (included)
+void countSceneNodes(is::ISceneNode * node, u32 & nodeCount, u32 & animatorCount);
 // Modify the active wall and shape
 void changeWallAndShape(int wallNumber, int shapeNumber,
                    is::IMeshSceneNode* leftWallNode, iv::ITexture* leftWallTex,
@@ -30,10 +40,11 @@ public:
         // If input is of keyboard type  (KEY_INPUT)
         // and a pressed key
         // and the key is ESCAPE
+        // we leave the main loop, so that the video capture gets flushed
         if (event.EventType == EET_KEY_INPUT_EVENT &&
                 event.KeyInput.PressedDown &&
                 event.KeyInput.Key == KEY_ESCAPE)
-            exit(0);
+            QuitRequested = true;
         if (event.EventType == irr::EET_KEY_INPUT_EVENT)
             KeyIsDown[event.KeyInput.Key] = event.KeyInput.PressedDown;
         return false;
@@ -43,25 +54,56 @@ public:
     {
         return KeyIsDown[keyCode];
     }
+
+    bool IsQuitRequested() const
+    {
+        return QuitRequested;
+    }
     MyEventReceiver()
     {
         for (u32 i=0; i<KEY_KEY_CODES_COUNT; ++i)
             KeyIsDown[i] = false;
+        QuitRequested = false;
     }
 private:
     //store the state of each key
     bool KeyIsDown[KEY_KEY_CODES_COUNT];
+    bool QuitRequested;
 };
 
-int main()
+int main(int argc, char **argv)
 {
+  // Command line options
+  // --capture <file.y4m> : record the session to a Y4M video
+  // --software           : use the software renderer instead of OpenGL
+  // --stats-socket <path> : serve live runtime stats on a Unix domain socket
+  const char *capturePath = NULL;
+  const char *statsSocketPath = NULL;
+  iv::E_DRIVER_TYPE driverType = iv::EDT_OPENGL;
+  for(int i=1 ; i<argc ; ++i)
+  {
+    if(strcmp(argv[i], "--capture") == 0 && i+1 < argc)
+      capturePath = argv[++i];
+    else if(strcmp(argv[i], "--stats-socket") == 0 && i+1 < argc)
+      statsSocketPath = argv[++i];
+    else if(strcmp(argv[i], "--software") == 0)
+      driverType = iv::EDT_BURNINGSVIDEO;
+    else
+      std::cerr<<"Unknown option "<<argv[i]<<std::endl;
+  }
+
   // Initialize random seed
   srand (time(NULL));
 
+  // Runtime stats, served by a background thread
+  RuntimeStats stats;
+  if(statsSocketPath != NULL)
+    stats.startServer(statsSocketPath);
+
   // Event Receiver
   MyEventReceiver receiver;
   // Initialization of the rendering system and window
-  IrrlichtDevice *device = createDevice(iv::EDT_OPENGL,
+  IrrlichtDevice *device = createDevice(driverType,
                                         ic::dimension2d<u32>(640, 480),
                                         16, false, false, false, &receiver);
   device->setWindowCaption(L"Unicycle Odyssey");
@@ -83,6 +125,19 @@ int main()
   int width = device->getVideoDriver()->getScreenSize().Width;
   int height = device->getVideoDriver()->getScreenSize().Height;
 
+  // Video capture, the frames are written by a background thread
+  VideoCapture *capture = NULL;
+  if(capturePath != NULL)
+  {
+    capture = new VideoCapture(capturePath, driver, 60);
+    if(!capture->isOpen())
+    {
+      std::cerr<<"Video capture disabled"<<std::endl;
+      delete capture;
+      capture = NULL;
+    }
+  }
+
   // We want the character to be able to cross the road from one
   // end to the other in the interval of 2 walls
   float characterTransversalSpeed = roadWidth/(24/backgroundSpeed);
@@ -140,67 +195,52 @@ int main()
 
   int score = 0;
 
+  // Static world: the road, the grass and the sky are baked in world space
+  // into a single mesh (one buffer per texture) stored on the GPU.
+  // The scrolling is done by translating the texture coordinates of the
+  // road and the grass, so the geometry never moves.
+  is::SMesh * worldMesh = new is::SMesh();
+
   // Load the ground
   is::IMesh * groundMesh = loadIMeshFromOBJ(smgr, "data/ground.obj");
   iv::ITexture * groundTex = driver->getTexture("data/Bois.png");
-
-
-
-  // Create nodes for the ground
-  is::IMeshSceneNode * groundNode = smgr->addMeshSceneNode(groundMesh);
-  is::ISceneNodeAnimator * groundAnimator =
-          smgr->createFlyStraightAnimator(ic::vector3df(0,0,0),
-                                          ic::vector3df(0,0,-24),
-                                          roadLength/10.0f/backgroundSpeed*1000*2,
-                                          true
-                                          );
-
-
-
-
-  // Initialize the ground mesh node
-  groundNode->setPosition(ic::vector3df(0,0,0));
-  groundNode->setScale(ic::vector3df(roadWidth,1,roadLength));
-  groundNode->setMaterialFlag(irr::video::EMF_LIGHTING, false);
-  groundNode->setMaterialTexture(0, groundTex);
-//  groundNode->getMaterial(0).getTextureMatrix(0).setTextureScale(roadLength, 1);
-  groundNode->addAnimator(groundAnimator);
+  ic::matrix4 groundTransform;
+  groundTransform.setScale(ic::vector3df(roadWidth,1,roadLength));
+  const u32 groundBuffer = addStaticWorldBuffer(smgr, worldMesh, groundMesh, groundTex, groundTransform);
 
   // Load sky
   is::IMesh * skyMesh = loadIMeshFromOBJ(smgr, "data/sky.obj");
-  iv::ITexture * skyText = driver->getTexture("data/sky.jpg");  
-
-  // Create nodes for the sky
-  is::IMeshSceneNode * skyNode = smgr->addMeshSceneNode(skyMesh);
-  // Initialize the sky mesh node
-  skyNode->setPosition(ic::vector3df(-45,-10,50));
-  skyNode->setRotation(ic::vector3df(-90,0,0));
-  skyNode->setScale(ic::vector3df(100,100,100));
-  skyNode->setMaterialFlag(irr::video::EMF_LIGHTING, false);
-  skyNode->setMaterialTexture(0, skyText);
-//  skyNode->getMaterial(0).getTextureMatrix(0).setTextureScale(roadLength, 1);
+  iv::ITexture * skyText = driver->getTexture("data/sky.jpg");
+  ic::matrix4 skyTransform;
+  skyTransform.setRotationDegrees(ic::vector3df(-90,0,0));
+  skyTransform.setTranslation(ic::vector3df(-45,-10,50));
+  skyTransform *= ic::matrix4().setScale(ic::vector3df(100,100,100));
+  addStaticWorldBuffer(smgr, worldMesh, skyMesh, skyText, skyTransform);
 
   // Load grass
   is::IMesh * grassMesh = loadIMeshFromOBJ(smgr, "data/grass.obj");
-  iv::ITexture * grassText = driver->getTexture("data/grass.jpg");  
-
-
-  is::ISceneNodeAnimator * grassAnimator =
-          smgr->createFlyStraightAnimator(ic::vector3df(-50,-0.1,0),
-                                          ic::vector3df(-50,-0.1,-24),
-                                          roadLength/10.0f/backgroundSpeed*1000*2,
-                                          true
-                                          );
-  // Create nodes for the grass
-  is::IMeshSceneNode * grassNode = smgr->addMeshSceneNode(grassMesh);
-  // Initialize the grass mesh node
-  grassNode->setPosition(ic::vector3df(-50,-0.1,0));
-  grassNode->setRotation(ic::vector3df(0,0,0));
-  grassNode->setScale(ic::vector3df(100,100,100));
-  grassNode->setMaterialFlag(irr::video::EMF_LIGHTING, false);
-  grassNode->setMaterialTexture(0, grassText);
-  grassNode->addAnimator(grassAnimator);
-//  skyNode->getMaterial(0).getTextureMatrix(0).setTextureScale(roadLength, 1);
+  iv::ITexture * grassText = driver->getTexture("data/grass.jpg");
+  ic::matrix4 grassTransform;
+  grassTransform.setTranslation(ic::vector3df(-50,-0.1,0));
+  grassTransform *= ic::matrix4().setScale(ic::vector3df(100,100,100));
+  const u32 grassBuffer = addStaticWorldBuffer(smgr, worldMesh, grassMesh, grassText, grassTransform);
+
+  // The OBJ meshes were only templates, the world mesh has its own copy
+  smgr->getMeshCache()->removeMesh(groundMesh);
+  smgr->getMeshCache()->removeMesh(skyMesh);
+  smgr->getMeshCache()->removeMesh(grassMesh);
+
+  worldMesh->recalculateBoundingBox();
+  worldMesh->setHardwareMappingHint(is::EHM_STATIC);
+  is::IMeshSceneNode * worldNode = smgr->addMeshSceneNode(worldMesh);
+  worldMesh->drop();
+
+  // The background moves at the same speed as the walls: 24m per wall period.
+  // Offsets are kept in [0,1[ so they don't lose precision in long sessions.
+  float worldScrollSpeed = 24/(roadLength/10.0f/backgroundSpeed*2);
+  float groundTexOffset = 0;
+  float grassTexOffset = 0;
+  u32 lastFrameTime = device->getTimer()->getTime();
     
   // Loading a character mesh
   is::IAnimatedMesh *mesh_character = smgr->getMesh("data/character.x");
@@ -292,9 +332,33 @@ int main()
   rightWallNode->getMaterial(0).getTextureMatrix(0).setTextureTranslate(0,0.15);
 
 
+  // All the assets are loaded
+  stats.set(RuntimeStats::TEXTURES, driver->getTextureCount());
+  stats.set(RuntimeStats::MESHES, smgr->getMeshCache()->getMeshCount());
+  stats.set(RuntimeStats::BACKGROUND_SPEED, backgroundSpeed);
+
   bool alreadyChecked = false;
-  while(device->run())
+  while(device->run() && !receiver.IsQuitRequested())
   {
+    u32 now = device->getTimer()->getTime();
+    float elapsedTime = (now - lastFrameTime) / 1000.0f;
+    lastFrameTime = now;
+
+    // Walking the scene graph is not free, only do it about once per second
+    if(stats.get(RuntimeStats::FRAMES) % 60 == 0)
+    {
+      u32 nodeCount = 0;
+      u32 animatorCount = 0;
+      countSceneNodes(smgr->getRootSceneNode(), nodeCount, animatorCount);
+      stats.set(RuntimeStats::SCENE_NODES, nodeCount);
+      stats.set(RuntimeStats::ANIMATORS, animatorCount);
+      stats.set(RuntimeStats::TEXTURES, driver->getTextureCount());
+      stats.set(RuntimeStats::MESHES, smgr->getMeshCache()->getMeshCount());
+      if(capture != NULL)
+        stats.set(RuntimeStats::CAPTURE_DROPPED, capture->getDroppedCount());
+    }
+    stats.increment(RuntimeStats::FRAMES);
+
     driver->beginScene(true, true, iv::SColor(0,250,255,255));
 
     // Draw Axes
@@ -307,8 +371,7 @@ int main()
 
     if(startButton->isPressed() == false && startButton->isEnabled() == true)
     {
-        gui->drawAll();
-        driver->endScene();
+        // Only the start screen is shown
     }
     else
     {
@@ -327,7 +390,10 @@ int main()
             {
                 // Increase speed
                 backgroundSpeed += 0.5;
+                stats.increment(RuntimeStats::WALLS_PASSED);
+                stats.set(RuntimeStats::BACKGROUND_SPEED, backgroundSpeed);
                 characterTransversalSpeed = roadWidth/(24/backgroundSpeed);
+                worldScrollSpeed = 24/(roadLength/10.0f/backgroundSpeed*2);
 
                 leftWallAnimator = smgr->createFlyStraightAnimator(
                             ic::vector3df(1,1,24),
@@ -347,23 +413,9 @@ int main()
                             roadLength/10.0f/backgroundSpeed*1000*2,
                             false
                             );
-                grassAnimator = smgr->createFlyStraightAnimator(
-                            ic::vector3df(-50,-0.1,0),
-                            ic::vector3df(-50,-0.1,-24),
-                            roadLength/10.0f/backgroundSpeed*1000*2,
-                            true
-                            );
-                groundAnimator = smgr->createFlyStraightAnimator(
-                            ic::vector3df(0,0,0),
-                            ic::vector3df(0,0,-24),
-                            roadLength/10.0f/backgroundSpeed*1000*2,
-                            true
-                            );
                 leftWallNode->addAnimator(leftWallAnimator);
                 middleWallNode->addAnimator(middleWallAnimator);
                 rightWallNode->addAnimator(rightWallAnimator);
-                grassNode->addAnimator(grassAnimator);
-                groundNode->addAnimator(groundAnimator);
 
                 // Randomly set a shape in a wall
                 wallNumber = rand()%3;
@@ -451,6 +503,12 @@ int main()
             node_character->setPosition(nodePosition);
             node_bike->setPosition(nodeBikePosition);
 
+            // Scroll the road and the grass towards the camera
+            groundTexOffset = fmodf(groundTexOffset + worldScrollSpeed * elapsedTime / roadLength, 1.0f);
+            grassTexOffset = fmodf(grassTexOffset + worldScrollSpeed * elapsedTime / 100.0f, 1.0f);
+            worldNode->getMaterial(groundBuffer).getTextureMatrix(0).setTextureTranslate(groundTexOffset, 0);
+            worldNode->getMaterial(grassBuffer).getTextureMatrix(0).setTextureTranslate(grassTexOffset, 0);
+
             if(leftWallNode->getPosition().Z > 3.3 && leftWallNode->getPosition().Z < 4)
             {
                 if(!alreadyChecked)
@@ -464,12 +522,11 @@ int main()
                         imageGameoverScreen->setUseAlphaChannel(true);
                         imageGameoverScreen->setImage(gameoverScreenText);
                         imageGameoverScreen->setScaleImage(true);
-                        gui->drawAll();
-                        driver->endScene();
                     }
                     else
                     {
                         score++;
+                        stats.set(RuntimeStats::SCORE, score);
                     }
                     alreadyChecked = true;
                 }
@@ -485,10 +542,17 @@ int main()
             // Draw the scene
             smgr->drawAll();
         }
-        gui->drawAll();
-        driver->endScene();
     }
+    gui->drawAll();
+
+    // Grab the frame before endScene() swaps the buffers,
+    // as the back buffer content is undefined after the swap
+    if(capture != NULL)
+      capture->captureFrame(device->getTimer()->getTime());
+
+    driver->endScene();
   }
+  delete capture;
   device->drop();
 
   return 0;
@@ -506,6 +570,38 @@ void drawAxes(video::IVideoDriver *driver)
     driver->draw3DLine(ic::vector3df(0,0,0),ic::vector3df(0,0,1),iv::SColor(0,0,0,255));
 }
 
+u32 addStaticWorldBuffer(is::ISceneManager * smgr, is::SMesh * worldMesh,
+                         is::IMesh * mesh, iv::ITexture * texture,
+                         const ic::matrix4 & transform)
+{
+    is::SMeshBuffer * buffer = new is::SMeshBuffer();
+    if(mesh != NULL)
+    {
+        is::IMeshBuffer * source = mesh->getMeshBuffer(0);
+        buffer->append(source->getVertices(), source->getVertexCount(),
+                       source->getIndices(), source->getIndexCount());
+        smgr->getMeshManipulator()->transform(buffer, transform);
+    }
+    buffer->Material.setFlag(irr::video::EMF_LIGHTING, false);
+    buffer->Material.setTexture(0, texture);
+    buffer->recalculateBoundingBox();
+
+    worldMesh->addMeshBuffer(buffer);
+    buffer->drop();
+
+    return worldMesh->getMeshBufferCount() - 1;
+}
+
+void countSceneNodes(is::ISceneNode * node, u32 & nodeCount, u32 & animatorCount)
+{
+    nodeCount++;
+    animatorCount += node->getAnimators().size();
+
+    const ic::list<is::ISceneNode*> & children = node->getChildren();
+    for(ic::list<is::ISceneNode*>::ConstIterator it = children.begin() ; it != children.end() ; ++it)
+        countSceneNodes(*it, nodeCount, animatorCount);
+}
+
 void changeWallAndShape(int wallNumber, int shapeNumber,
                    is::IMeshSceneNode* leftWallNode, iv::ITexture* leftWallTex,
                    is::IMeshSceneNode* middleWallNode, iv::ITexture* middleWallTex,
@@ -0,0 +1,170 @@
+#include "runtimeStats.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char * counterNames[RuntimeStats::COUNTER_COUNT] =
+{
+    "frames",
+    "walls_passed"
+};
+
+static const char * gaugeNames[RuntimeStats::GAUGE_COUNT] =
+{
+    "background_speed",
+    "score",
+    "scene_nodes",
+    "animators",
+    "textures",
+    "meshes",
+    "capture_dropped"
+};
+
+RuntimeStats::RuntimeStats()
+    : serverSocket(-1),
+      stopRequested(false)
+{
+    for(int i=0 ; i < COUNTER_COUNT ; ++i)
+        counters[i] = 0;
+    for(int i=0 ; i < GAUGE_COUNT ; ++i)
+        gauges[i] = 0;
+}
+
+RuntimeStats::~RuntimeStats()
+{
+    stopServer();
+}
+
+std::string RuntimeStats::snapshot() const
+{
+    std::string json = "{";
+    char value[64];
+    for(int i=0 ; i < COUNTER_COUNT ; ++i)
+    {
+        snprintf(value, sizeof(value), "%llu", counters[i].load(std::memory_order_relaxed));
+        json += std::string(i > 0 ? "," : "") + "\"" + counterNames[i] + "\":" + value;
+    }
+    for(int i=0 ; i < GAUGE_COUNT ; ++i)
+    {
+        snprintf(value, sizeof(value), "%g", gauges[i].load(std::memory_order_relaxed));
+        json += std::string(",\"") + gaugeNames[i] + "\":" + value;
+    }
+    json += "}\n";
+    return json;
+}
+
+bool RuntimeStats::startServer(const char * socketPath)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        std::cerr<<"Stats socket path too long: "<<socketPath<<std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    // Remove a socket left by a previous session, but never another kind
+    // of file, nor a socket a running instance is still listening on
+    struct stat status;
+    if(lstat(socketPath, &status) == 0)
+    {
+        if(!S_ISSOCK(status.st_mode))
+        {
+            std::cerr<<socketPath<<" exists and is not a socket"<<std::endl;
+            return false;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(probe < 0)
+        {
+            std::cerr<<"Cannot create the stats socket"<<std::endl;
+            return false;
+        }
+        bool connected = connect(probe, (sockaddr *)&address, sizeof(address)) == 0;
+        int error = errno;
+        close(probe);
+        if(connected)
+        {
+            std::cerr<<socketPath<<" is in use by another process"<<std::endl;
+            return false;
+        }
+        if(error != ECONNREFUSED)
+        {
+            std::cerr<<"Cannot check "<<socketPath<<": "<<strerror(error)<<std::endl;
+            return false;
+        }
+        unlink(socketPath);
+    }
+
+    serverSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(serverSocket < 0)
+    {
+        std::cerr<<"Cannot create the stats socket"<<std::endl;
+        return false;
+    }
+    if(bind(serverSocket, (sockaddr *)&address, sizeof(address)) < 0
+            || listen(serverSocket, 4) < 0)
+    {
+        std::cerr<<"Cannot listen on "<<socketPath<<std::endl;
+        close(serverSocket);
+        serverSocket = -1;
+        return false;
+    }
+
+    serverPath = socketPath;
+    stopRequested = false;
+    server = std::thread(&RuntimeStats::serverLoop, this);
+    return true;
+}
+
+void RuntimeStats::stopServer()
+{
+    if(serverSocket < 0)
+        return;
+
+    stopRequested = true;
+    server.join();
+
+    close(serverSocket);
+    serverSocket = -1;
+    unlink(serverPath.c_str());
+}
+
+void RuntimeStats::serverLoop()
+{
+#ifdef SCHED_IDLE
+    // Only run when the render loop leaves the CPU idle
+    sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+    while(!stopRequested)
+    {
+        // Wake up regularly to check if we have to stop
+        pollfd request;
+        request.fd = serverSocket;
+        request.events = POLLIN;
+        if(poll(&request, 1, 200) <= 0)
+            continue;
+
+        int client = accept(serverSocket, NULL, NULL);
+        if(client < 0)
+            continue;
+
+        std::string json = snapshot();
+        send(client, json.c_str(), json.size(), MSG_NOSIGNAL);
+        close(client);
+    }
+}
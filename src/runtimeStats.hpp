@@ -0,0 +1,75 @@
+#ifndef RUNTIMESTATS_HPP
+#define RUNTIMESTATS_HPP
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Live runtime counters and gauges.
+// The main loop updates them with relaxed atomics, so it never blocks.
+// When started, a low priority thread serves a JSON snapshot to every client
+// connecting to a local Unix domain socket, e.g. :
+//   socat - UNIX-CONNECT:/tmp/unicycle.sock
+class RuntimeStats
+{
+public:
+    // Monotonic counters
+    enum Counter
+    {
+        FRAMES,
+        WALLS_PASSED,
+        COUNTER_COUNT
+    };
+
+    // Values that can go up and down
+    enum Gauge
+    {
+        BACKGROUND_SPEED,
+        SCORE,
+        SCENE_NODES,
+        ANIMATORS,
+        TEXTURES,
+        MESHES,
+        CAPTURE_DROPPED,
+        GAUGE_COUNT
+    };
+
+    RuntimeStats();
+    ~RuntimeStats();
+
+    void increment(Counter counter, unsigned long long value = 1)
+    {
+        counters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void set(Gauge gauge, double value)
+    {
+        gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+
+    unsigned long long get(Counter counter) const
+    {
+        return counters[counter].load(std::memory_order_relaxed);
+    }
+
+    // Write the current values as a single line JSON object
+    std::string snapshot() const;
+
+    // Serve snapshots on the given socket path, returns false on failure
+    bool startServer(const char * socketPath);
+    // Stop the server thread and remove the socket file
+    void stopServer();
+
+private:
+    void serverLoop();
+
+    std::atomic<unsigned long long> counters[COUNTER_COUNT];
+    std::atomic<double> gauges[GAUGE_COUNT];
+
+    int serverSocket;
+    std::string serverPath;
+    std::atomic<bool> stopRequested;
+    std::thread server;
+};
+
+#endif // RUNTIMESTATS_HPP
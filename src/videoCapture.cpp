@@ -0,0 +1,334 @@
+#include "videoCapture.hpp"
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <cstring>
+#include <iostream>
+
+using namespace irr;
+
+// Number of OpenGL reads in flight, a read is collected this many captures later
+static const u32 pixelBufferCount = 3;
+
+VideoCapture::VideoCapture(const char * filepath, iv::IVideoDriver * driver,
+                           u32 fps, u32 ringSize)
+    : file(NULL),
+      driver(driver),
+      // 4:2:0 chroma subsampling needs even dimensions
+      width(driver->getScreenSize().Width & ~1u),
+      height(driver->getScreenSize().Height & ~1u),
+      bottomUp(driver->getDriverType() == iv::EDT_OPENGL),
+      usePixelBuffers(false),
+      nextPixelBuffer(0),
+      frameDuration(1000.0 / fps),
+      nextFrameTime(0),
+      started(false),
+      pendingRepeats(0),
+      dropped(0),
+      ring(ringSize),
+      head(0),
+      tail(0),
+      stopRequested(false),
+      writeFailed(false),
+      written(0),
+      yuvBuffer(width * height * 3 / 2)
+{
+    for(u32 i=0 ; i < ring.size() ; ++i)
+        ring[i].pixels.resize(width * height);
+    // Start from a black frame, in case the first frames are repeats
+    memset(yuvBuffer.data(), 0, width * height);
+    memset(yuvBuffer.data() + width * height, 128, width * height / 2);
+
+    file = fopen(filepath, "wb");
+    if(file == NULL)
+    {
+        std::cerr<<"Cannot open "<<filepath<<" for video capture"<<std::endl;
+        return;
+    }
+    // The samples are full range, players assume limited range unless told otherwise
+    if(fprintf(file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n",
+               width, height, fps) < 0)
+    {
+        std::cerr<<"Cannot write to "<<filepath<<std::endl;
+        fclose(file);
+        file = NULL;
+        return;
+    }
+
+    if(driver->getDriverType() == iv::EDT_OPENGL)
+    {
+        // Pixel buffer objects are core since OpenGL 2.1
+        int major = 0, minor = 0;
+        const char * version = (const char *)glGetString(GL_VERSION);
+        if(version != NULL && sscanf(version, "%d.%d", &major, &minor) == 2)
+            usePixelBuffers = major > 2 || (major == 2 && minor >= 1);
+    }
+    if(usePixelBuffers)
+    {
+        pixelBuffers.resize(pixelBufferCount);
+        for(u32 i=0 ; i < pixelBuffers.size() ; ++i)
+        {
+            glGenBuffers(1, &pixelBuffers[i].id);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i].id);
+            glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+            pixelBuffers[i].pending = false;
+            pixelBuffers[i].boundaries = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    writer = std::thread(&VideoCapture::writerLoop, this);
+}
+
+VideoCapture::~VideoCapture()
+{
+    stop();
+}
+
+void VideoCapture::captureFrame(u32 time)
+{
+    if(file == NULL || writeFailed)
+        return;
+
+    if(!started)
+    {
+        nextFrameTime = time;
+        started = true;
+    }
+    if(time < nextFrameTime)
+        return;
+
+    // Number of frame boundaries passed since the last capture,
+    // all but the last one are filled with the previous frame
+    u32 boundaries = (u32)((time - nextFrameTime) / frameDuration) + 1;
+    nextFrameTime += boundaries * frameDuration;
+
+    if(usePixelBuffers)
+    {
+        // The read issued pixelBufferCount captures ago has completed by now,
+        // collect it before reusing its buffer
+        PixelBuffer & buffer = pixelBuffers[nextPixelBuffer];
+        if(buffer.pending)
+            collectPixelBuffer(buffer, false);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.id);
+        glReadBuffer(GL_BACK);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        buffer.pending = true;
+        buffer.boundaries = boundaries;
+        nextPixelBuffer = (nextPixelBuffer + 1) % pixelBuffers.size();
+        return;
+    }
+
+    // The writer is behind, don't wait for it
+    Frame * frame = acquireSlot(false);
+    if(frame == NULL || !readBackBuffer(frame->pixels.data()))
+    {
+        dropFrame(boundaries);
+        return;
+    }
+    publishSlot(boundaries);
+}
+
+void VideoCapture::collectPixelBuffer(PixelBuffer & buffer, bool wait)
+{
+    buffer.pending = false;
+
+    Frame * frame = acquireSlot(wait);
+    if(frame == NULL)
+    {
+        dropFrame(buffer.boundaries);
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.id);
+    const void * pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if(pixels != NULL)
+    {
+        memcpy(frame->pixels.data(), pixels, width * height * 4);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if(pixels == NULL)
+        dropFrame(buffer.boundaries);
+    else
+        publishSlot(buffer.boundaries);
+}
+
+VideoCapture::Frame * VideoCapture::acquireSlot(bool wait)
+{
+    u32 h = head.load(std::memory_order_relaxed);
+    while(h - tail.load(std::memory_order_acquire) >= ring.size())
+    {
+        if(!wait || writeFailed)
+            return NULL;
+        std::this_thread::yield();
+    }
+    return &ring[h % ring.size()];
+}
+
+void VideoCapture::publishSlot(u32 boundaries)
+{
+    u32 h = head.load(std::memory_order_relaxed);
+    ring[h % ring.size()].repeatPrevious = pendingRepeats + boundaries - 1;
+    pendingRepeats = 0;
+
+    head.store(h + 1, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    frameReady.notify_one();
+}
+
+void VideoCapture::dropFrame(u32 boundaries)
+{
+    dropped += boundaries;
+    pendingRepeats += boundaries;
+}
+
+bool VideoCapture::readBackBuffer(u32 * target)
+{
+    if(driver->getDriverType() == iv::EDT_OPENGL)
+    {
+        // Without pixel buffer objects, a synchronous read straight into the ring slot
+        glReadBuffer(GL_BACK);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, target);
+        return true;
+    }
+
+    // IVideoDriver gives no access to the software drivers' back buffer:
+    // createScreenShot() is the only readback, and it always returns a new image.
+    // The software rasterizer costs far more per frame than this copy anyway.
+    iv::IImage * screenshot = driver->createScreenShot();
+    if(screenshot == NULL)
+        return false;
+    screenshot->copyToScaling(target, width, height, iv::ECF_A8R8G8B8);
+    screenshot->drop();
+    return true;
+}
+
+void VideoCapture::stop()
+{
+    if(file == NULL)
+        return;
+
+    // Collect the reads still in flight, in the order they were issued
+    for(u32 i=0 ; i < pixelBuffers.size() ; ++i)
+    {
+        PixelBuffer & buffer = pixelBuffers[(nextPixelBuffer + i) % pixelBuffers.size()];
+        if(buffer.pending)
+            collectPixelBuffer(buffer, true);
+        glDeleteBuffers(1, &buffer.id);
+    }
+    pixelBuffers.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopRequested = true;
+    }
+    frameReady.notify_one();
+    writer.join();
+
+    // Keep the video as long as the session
+    for(u32 i=0 ; i < pendingRepeats && !writeFailed ; ++i)
+        writeFailed = !writeYuvBuffer();
+
+    if(fclose(file) != 0)
+        writeFailed = true;
+    file = NULL;
+
+    // Buffered frames may have been lost, so don't report a count on failure
+    if(writeFailed)
+        std::cerr<<"Video capture: write error, the video is truncated"<<std::endl;
+    else
+        std::cout<<"Video capture: "<<written<<" frames written, "
+                 <<dropped<<" frames dropped"<<std::endl;
+}
+
+void VideoCapture::writerLoop()
+{
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameReady.wait(lock, [this]{
+                return tail.load(std::memory_order_relaxed) != head.load(std::memory_order_acquire)
+                        || stopRequested;
+            });
+        }
+
+        u32 t = tail.load(std::memory_order_relaxed);
+        if(t == head.load(std::memory_order_acquire))
+        {
+            // Nothing left to write, and we have been asked to stop
+            break;
+        }
+
+        if(!writeFrame(ring[t % ring.size()]))
+        {
+            // Stop writing, the render loop will stop capturing
+            writeFailed = true;
+            break;
+        }
+        tail.store(t + 1, std::memory_order_release);
+    }
+}
+
+bool VideoCapture::writeFrame(const Frame & frame)
+{
+    for(u32 i=0 ; i < frame.repeatPrevious ; ++i)
+    {
+        if(!writeYuvBuffer())
+            return false;
+    }
+
+    u8 * yPlane = yuvBuffer.data();
+    u8 * uPlane = yPlane + width * height;
+    u8 * vPlane = uPlane + width * height / 4;
+
+    // Full range BT.601 (JFIF) conversion, in 8 bit fixed point
+    for(u32 y=0 ; y < height ; y+=2)
+    {
+        for(u32 x=0 ; x < width ; x+=2)
+        {
+            s32 sumR = 0, sumG = 0, sumB = 0;
+            for(u32 j=0 ; j < 2 ; ++j)
+            {
+                u32 row = bottomUp ? height - 1 - (y+j) : y+j;
+                for(u32 i=0 ; i < 2 ; ++i)
+                {
+                    u32 pixel = frame.pixels[row*width + x+i];
+                    s32 r = (pixel >> 16) & 0xff;
+                    s32 g = (pixel >> 8) & 0xff;
+                    s32 b = pixel & 0xff;
+                    yPlane[(y+j)*width + x+i] = (u8)((77*r + 150*g + 29*b) >> 8);
+                    sumR += r;
+                    sumG += g;
+                    sumB += b;
+                }
+            }
+            s32 r = sumR / 4, g = sumG / 4, b = sumB / 4;
+            uPlane[(y/2)*(width/2) + x/2] = (u8)((-43*r - 85*g + 128*b + 32768) >> 8);
+            vPlane[(y/2)*(width/2) + x/2] = (u8)((128*r - 107*g - 21*b + 32768) >> 8);
+        }
+    }
+
+    return writeYuvBuffer();
+}
+
+bool VideoCapture::writeYuvBuffer()
+{
+    if(fputs("FRAME\n", file) == EOF
+            || fwrite(yuvBuffer.data(), 1, yuvBuffer.size(), file) != yuvBuffer.size())
+    {
+        return false;
+    }
+    written++;
+    return true;
+}
@@ -0,0 +1,117 @@
+#ifndef VIDEOCAPTURE_HPP
+#define VIDEOCAPTURE_HPP
+
+#include <irrlicht.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace iv = irr::video;
+
+// In-engine gameplay recorder.
+// Frames are read back from the back buffer into a ring of preallocated
+// buffers, at a fixed frame rate driven by the device timer, and a
+// background thread encodes them to a Y4M (YUV 4:2:0) file.
+// With OpenGL 2.1 the read goes through pixel buffer objects and is
+// collected a few frames later, so the GPU pipeline is never flushed.
+// The render loop never waits on disk I/O: if the writer falls behind and
+// the ring is full, the frame is dropped and counted. Missed and dropped
+// frames are replaced by a copy of the previous one, so the video keeps
+// the real duration of the session.
+class VideoCapture
+{
+public:
+    // Record what driver renders, at its screen size
+    VideoCapture(const char * filepath, iv::IVideoDriver * driver,
+                 irr::u32 fps, irr::u32 ringSize = 8);
+    ~VideoCapture();
+
+    // True if the output file could be opened and the writer is running
+    bool isOpen() const { return file != NULL; }
+
+    // Copy the frame being rendered into the ring if a new 1/fps boundary
+    // has passed. To be called after drawing and before endScene(), while
+    // the back buffer still holds the frame. time is in milliseconds.
+    void captureFrame(irr::u32 time);
+
+    // Flush the pending frames, stop the writer and close the file.
+    // Must be called before the device is dropped, while the GL context exists
+    void stop();
+
+    // Frames lost because the writer was behind
+    irr::u32 getDroppedCount() const { return dropped; }
+
+private:
+    struct Frame
+    {
+        std::vector<irr::u32> pixels; // A8R8G8B8
+        irr::u32 repeatPrevious;      // Copies of the previous frame to write first
+    };
+
+    // Asynchronous OpenGL read, in flight until collected
+    struct PixelBuffer
+    {
+        unsigned int id;       // GLuint
+        bool pending;          // A read has been issued and not collected yet
+        irr::u32 boundaries;   // Frame boundaries covered by this read
+    };
+
+    // Read the back buffer into target, returns false on failure
+    bool readBackBuffer(irr::u32 * target);
+    // Copy a completed pixel buffer read into the ring
+    void collectPixelBuffer(PixelBuffer & buffer, bool wait);
+
+    // Next ring slot to fill, NULL if the ring is full and wait is false
+    Frame * acquireSlot(bool wait);
+    // Hand the slot returned by acquireSlot() to the writer
+    void publishSlot(irr::u32 boundaries);
+    // Count a lost frame, its boundaries are filled with the previous frame
+    void dropFrame(irr::u32 boundaries);
+
+    void writerLoop();
+    // Convert a frame to YUV 4:2:0 and append it to the file,
+    // returns false on write error
+    bool writeFrame(const Frame & frame);
+    // Append the last converted frame to the file
+    bool writeYuvBuffer();
+
+    FILE * file;
+    iv::IVideoDriver * driver;
+    irr::u32 width;
+    irr::u32 height;
+    // OpenGL rows are read bottom to top
+    bool bottomUp;
+
+    // Only used with OpenGL 2.1 and later
+    bool usePixelBuffers;
+    std::vector<PixelBuffer> pixelBuffers;
+    irr::u32 nextPixelBuffer;
+
+    // Capture clock, in milliseconds
+    double frameDuration;
+    double nextFrameTime;
+    bool started;
+    // Frame boundaries that will be filled with the previous frame
+    irr::u32 pendingRepeats;
+    irr::u32 dropped;
+
+    // Single producer (render loop), single consumer (writer thread)
+    std::vector<Frame> ring;
+    std::atomic<irr::u32> head; // Next slot to fill, only written by the producer
+    std::atomic<irr::u32> tail; // Next slot to write, only written by the consumer
+    std::atomic<bool> stopRequested;
+    std::atomic<bool> writeFailed;
+    std::atomic<irr::u32> written;
+
+    // Only used by the writer thread, holds the last converted frame
+    std::vector<irr::u8> yuvBuffer;
+
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    std::thread writer;
+};
+
+#endif // VIDEOCAPTURE_HPP